@@ -1,14 +1,19 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents, keyed by (dev, blockno).
+// Each hash bucket has its own lock, so lookups of different
+// blocks proceed in parallel. The cache is sized at boot from
+// the amount of free memory.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write many blocks at once.
 // * When done with the buffer, call brelse.
+// * To start reading a block that will soon be needed, call breadahead.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
@@ -23,69 +28,211 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 1021
+#define HASH(dev, blockno) (((dev) * 31 + (blockno)) % NBUCKET)
+
+// a buffer's usage count saturates here.
+#define BMAXUSE 3
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;  // buffers whose block hashes here
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling of buffers
+  int nbuf;
+  struct buf *unused;    // never-used buffers, through next
+  struct buf *hand;      // CLOCK hand, moves along clock
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Size the cache from the memory left free at boot, and carve
+// buffers and their data out of kalloc() pages.
 void
 binit(void)
 {
-  struct buf *b;
+  struct buf *b, *last;
+  char *hdrs, *data;
+  int nhdr, ndata, n;
 
   initlock(&bcache.lock, "bcache");
+  for(int i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+
+  n = kfreepages() / BCACHEFRAC * (PGSIZE / BSIZE);
+  if(n < NBUF)
+    n = NBUF;
+
+  hdrs = data = 0;
+  nhdr = ndata = 0;
+  last = 0;
+  for(bcache.nbuf = 0; bcache.nbuf < n; bcache.nbuf++){
+    if(nhdr == 0){
+      if((hdrs = kalloc()) == 0)
+        break;
+      nhdr = PGSIZE / sizeof(struct buf);
+    }
+    if(ndata == 0){
+      if((data = kalloc()) == 0)
+        break;
+      ndata = PGSIZE / BSIZE;
+    }
+    b = (struct buf*)hdrs;
+    hdrs += sizeof(struct buf);
+    nhdr--;
+    memset(b, 0, sizeof(*b));
+    b->data = (uchar*)data;
+    data += BSIZE;
+    ndata--;
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->next = bcache.unused;
+    bcache.unused = b;
+    if(last)
+      last->clock = b;
+    else
+      bcache.hand = b;
+    last = b;
   }
+  if(bcache.nbuf < NBUF)
+    panic("binit");
+  last->clock = bcache.hand;
+}
+
+static struct bucket*
+bucketof(uint dev, uint blockno)
+{
+  return &bcache.bucket[HASH(dev, blockno)];
+}
+
+// Find the buffer for (dev, blockno) in bucket bk.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b != 0; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
+// Choose a buffer to recycle and take it out of its bucket.
+// Caller must hold bcache.lock, which also keeps every
+// buffer's dev and blockno, and so its bucket, stable.
+//
+// Replacement is CLOCK with usage counts: a hit bumps the
+// count, and the hand decrements the counts of unused buffers
+// as it passes, recycling the first one it finds at zero.
+// A block enters the cache with a count of zero, so a large
+// one-pass scan recycles its own buffers rather than pushing
+// out frequently used metadata blocks.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk;
+  struct buf *b, **pp;
+
+  if((b = bcache.unused) != 0){
+    bcache.unused = b->next;
+    return b;
+  }
+
+  for(int i = 0; i < bcache.nbuf * (BMAXUSE+1) + 1; i++){
+    b = bcache.hand;
+    bcache.hand = b->clock;
+    bk = bucketof(b->dev, b->blockno);
+    acquire(&bk->lock);
+    if(b->refcnt == 0){
+      if(b->usage == 0){
+        for(pp = &bk->head; *pp != b; pp = &(*pp)->next)
+          ;
+        *pp = b->next;
+        b->refcnt = 1;
+        release(&bk->lock);
+        return b;
+      }
+      b->usage--;
+    }
+    release(&bk->lock);
+  }
+  panic("bget: no buffers");
 }
 
 // Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// If not found, recycle a buffer for it.
+// In either case, return the buffer, unlocked, with a reference.
+// If ahead is set, the caller is reading ahead: return 0
+// rather than a buffer that is already cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bref(uint dev, uint blockno, int ahead)
 {
+  struct bucket *bk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = bucketof(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  // Only this block's bucket needs to be locked.
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(ahead){
+      b = 0;
+    } else {
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if(b->usage < BMAXUSE)
+        b->usage++;
     }
+    release(&bk->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // bcache.lock serializes recycling, so that two processes
+  // missing on the same block can't both cache it.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(ahead)
+      b = 0;
+    else
+      b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    return b;
   }
-  panic("bget: no buffers");
+  release(&bk->lock);
+
+  b = bvictim();
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  b->usage = 0;
+
+  acquire(&bk->lock);
+  b->next = bk->head;
+  bk->head = b;
+  release(&bk->lock);
+
+  release(&bcache.lock);
+  return b;
+}
+
+// Return a locked buffer for the block, which may not
+// yet hold its contents.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bref(dev, blockno, 0);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +249,39 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading a block into the cache, without waiting,
+// unless it is already cached or being read.
+// Returns -1 if the disk is too busy to take the read.
+int
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bref(dev, blockno, 1)) == 0)
+    return 0;
+  acquiresleep(&b->lock);
+  if(b->valid){
+    // someone else read it in the meantime.
+    brelse(b);
+    return 0;
+  }
+  if(virtio_disk_readahead(b) < 0){
+    brelse(b);
+    return -1;
+  }
+  return 0;
+}
+
+// Called by virtio_disk_intr() when a read started by
+// breadahead() finishes. Drops the reader's lock and reference.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bunpin(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +291,50 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of n locked bufs to disk, with as
+// few disk requests as possible. Runs of consecutive
+// blocks in bs go to the disk as one request.
+void
+bwritev(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  }
+  virtio_disk_rwv(bs, n, 1);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bucketof(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bucketof(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
-
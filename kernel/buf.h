@@ -5,8 +5,9 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
-  uchar data[BSIZE];
+  uint usage;  // recent hits, for CLOCK replacement
+  struct buf *next; // hash bucket chain
+  struct buf *clock; // circular list of all buffers
+  uchar *data; // BSIZE bytes, carved from a kalloc() page
 };
 
@@ -1,5 +1,6 @@
 struct buf;
 struct context;
+struct dirstat;
 struct file;
 struct inode;
 struct pipe;
@@ -14,8 +15,11 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             breadahead(uint, uint);
+void            bdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -32,12 +36,15 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filegetdents(struct file*, uint64 addr, int n);
 int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirunlink(struct inode*, uint);
+int             dirread(struct inode*, uint*, struct dirstat*, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
@@ -50,6 +57,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            readahead(struct inode*, uint, uint*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -61,14 +69,21 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+void            kdup(void *);
 void            kfree(void *);
 void            kinit(void);
+int             krefcnt(void *);
+int             kfreepages(void);
+int             kzeroidle(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+void            logstats(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -106,6 +121,8 @@ void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(void (*)(void), char*);
+int             nice(int);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
@@ -141,11 +158,14 @@ int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
 
+// timer.c
+void            timersinit(void);
+uint64          timernext(uint64);
+int             timersleep(uint64);
+void            timerexpire(void);
+
 // trap.c
-extern uint     ticks;
-void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -165,6 +185,8 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -183,6 +205,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_readahead(struct buf *);
+void            virtio_disk_rwv(struct buf **, int, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
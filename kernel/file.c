@@ -101,6 +101,28 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Read up to n entries of directory f, with their inodes'
+// metadata, into addr, a user array of struct dirstat.
+// Returns the number read, 0 at the end of the directory,
+// or -1 on error.
+int
+filegetdents(struct file *f, uint64 addr, int n)
+{
+  struct proc *p = myproc();
+  struct dirstat ds[NGETDENTS];
+  int m;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  if(n > NGETDENTS)
+    n = NGETDENTS;
+  if((m = dirread(f->ip, &f->off, ds, n)) <= 0)
+    return m;
+  if(copyout(p->pagetable, addr, (char*)ds, m * sizeof(ds[0])) < 0)
+    return -1;
+  return m;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -121,6 +143,15 @@ fileread(struct file *f, uint64 addr, int n)
     ilock(f->ip);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
+    // if this read carried on from where the last one
+    // stopped, read ahead of the next.
+    if(r == n){
+      if(f->off - r == f->ranext)
+        readahead(f->ip, f->off/BSIZE, &f->raend);
+      else
+        f->raend = 0;
+      f->ranext = f->off;
+    }
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -147,19 +178,22 @@ filewrite(struct file *f, uint64 addr, int n)
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // the maximum log transaction size: each data block
+    // and its allocation block, plus the i-node, the
+    // extent block that maps the blocks, and a new extent
+    // block and its allocation block if that one is full.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+      // stop at a block boundary, so that a non-aligned
+      // write touches no more than max/BSIZE blocks.
+      int n1 = max - f->off % BSIZE;
+      if(n1 > n - i)
+        n1 = n - i;
 
-      begin_op();
+      begin_opn(4 + 2*((f->off % BSIZE + n1 + BSIZE - 1) / BSIZE));
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
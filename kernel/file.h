@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint ranext;       // FD_INODE: offset where the last read stopped
+  uint raend;        // FD_INODE: first block not yet read ahead
   short major;       // FD_DEVICE
 };
 
@@ -18,6 +20,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *prev; // itable LRU list, if ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,7 +31,20 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  struct extent ext[NEXTENT];
+  struct extent prealloc;
+  uint xblock;
+
+  // where bmap() last found a block, to start the next search.
+  uint hintblk;       // extent block, or 0 for the inode
+  uint hintidx;       // index of the extent in it
+  uint hintbn;        // file block that extent starts at
+
+  // a large directory's name index; see dirlookup().
+  uint *dindex;       // hash table page, or 0
+  int dused;          // slots in use, including deleted ones,
+                      // or -1 if too big to index
+  uint dhole;         // no free dirents before this offset
 };
 
 // map major device number to device functions.
@@ -37,6 +37,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bcount(int dev);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,6 +46,7 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bcount(dev);
 }
 
 // Zero a block.
@@ -60,33 +63,125 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
-// returns 0 if out of disk space.
-static uint
-balloc(uint dev)
+// Where the last allocation ended, so that the next
+// search needn't start from block 0. There is only one
+// file system, so there is one hint.
+static uint bnext;
+
+// How many blocks are free, so that reservations for
+// growing files can shrink as the disk fills up.
+// Updated with atomic instructions; only a hint.
+static uint nfreeblocks;
+
+// Count the free blocks in the bitmap.
+static void
+bcount(int dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint b, bi;
 
-  bp = 0;
+  nfreeblocks = 0;
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
     for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        nfreeblocks++;
+    }
+    brelse(bp);
+  }
+}
+
+// Return the first clear bit in map from bit from up to,
+// but not including, bit to; or -1 if there is none.
+// Skips full 64-bit words and bytes at a time.
+static int
+bscan(uchar *map, int from, int to)
+{
+  int bi = from;
+
+  while(bi < to){
+    if(bi % 64 == 0 && bi + 64 <= to && ((uint64*)map)[bi/64] == ~0UL){
+      bi += 64;
+    } else if(bi % 8 == 0 && bi + 8 <= to && map[bi/8] == 0xff){
+      bi += 8;
+    } else if((map[bi/8] & (1 << (bi % 8))) == 0){
+      return bi;
+    } else {
+      bi++;
+    }
+  }
+  return -1;
+}
+
+// Find the first free block in [from, to), mark it and up
+// to n-1 free blocks right after it in use, and return it,
+// setting *got to the number marked. Return 0 if there is
+// no free block. The run stays within one bitmap block, so
+// that only one bitmap block is written.
+static uint
+ballocrange(uint dev, uint from, uint to, uint n, uint *got)
+{
+  uint b, base, end;
+  int bi;
+  struct buf *bp;
+
+  for(b = from; b < to; b = end){
+    base = b - b % BPB;
+    end = base + BPB < to ? base + BPB : to;
+    bp = bread(dev, BBLOCK(b, sb));
+    if((bi = bscan(bp->data, b - base, end - base)) >= 0){
+      for(*got = 0; *got < n && base + bi + *got < end; (*got)++){
+        int i = bi + *got;
+        if(bp->data[i/8] & (1 << (i % 8)))
+          break;
+        bp->data[i/8] |= 1 << (i % 8);  // Mark block in use.
       }
+      __sync_fetch_and_sub(&nfreeblocks, *got);
+      log_write(bp);
+      brelse(bp);
+      return base + bi;
     }
     brelse(bp);
   }
-  printf("balloc: out of blocks\n");
   return 0;
 }
 
+// Allocate a run of up to n blocks, not zeroed, at goal
+// if it is free, or else at the next free block after it.
+// A goal of 0 means no preference; search from where
+// the last allocation ended. Sets *got to the length of
+// the run. returns 0 if out of disk space.
+static uint
+ballocrun(uint dev, uint goal, uint n, uint *got)
+{
+  uint b;
+
+  *got = 0;
+  if(goal == 0 || goal >= sb.size)
+    goal = bnext;
+  if((b = ballocrange(dev, goal, sb.size, n, got)) == 0 &&
+     (b = ballocrange(dev, 0, goal, n, got)) == 0){
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  bnext = b + *got;
+  return b;
+}
+
+// Allocate a zeroed disk block, at goal if it is free,
+// or else at the next free block after it, so that a
+// file's blocks are contiguous.
+// returns 0 if out of disk space.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, got;
+
+  if((b = ballocrun(dev, goal, 1, &got)) != 0)
+    bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -100,10 +195,38 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  __sync_fetch_and_add(&nfreeblocks, 1);
   log_write(bp);
   brelse(bp);
 }
 
+// Free n consecutive blocks starting at start,
+// writing each bitmap block once.
+static void
+bfreerun(int dev, uint start, uint n)
+{
+  struct buf *bp;
+  uint b, end;
+  int bi, m;
+
+  for(b = start; b < start + n; b = end){
+    end = b - b % BPB + BPB;
+    if(end > start + n)
+      end = start + n;
+    bp = bread(dev, BBLOCK(b, sb));
+    for(; b < end; b++){
+      bi = b % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+      __sync_fetch_and_add(&nfreeblocks, 1);
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -130,17 +253,20 @@ bfree(int dev, uint b)
 //   the reference and link counts have fallen to zero.
 //
 // * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
+//   may be recycled if ip->ref is zero. Otherwise ip->ref
+//   tracks the number of in-memory pointers to the entry
+//   (open files and current directories). iget() finds or
 //   creates a table entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. Entries with ref zero stay in the table,
+//   on an LRU list, until iget() needs to recycle one, so
+//   that a recently used inode can be found again without
+//   reading it from disk.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -167,29 +293,72 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or the hash chains and LRU list.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 251
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  int ninode;
+  struct inode *hash[NIHASH];  // entries for each (dev, inum)
+  // Linked list of entries with ref zero, through prev/next.
+  // head.next is most recently used, head.prev is recycled first.
+  struct inode head;
 } itable;
 
+static void dcinit(void);
+
+// Size the table from the memory left free at boot,
+// and carve the entries out of kalloc() pages.
 void
 iinit()
 {
-  int i = 0;
-  
+  struct inode *ip;
+  char *page;
+  int n, left;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.head.prev = &itable.head;
+  itable.head.next = &itable.head;
+
+  n = kfreepages() / ICACHEFRAC * (PGSIZE / sizeof(struct inode));
+  if(n < NINODE)
+    n = NINODE;
+
+  page = 0;
+  left = 0;
+  for(itable.ninode = 0; itable.ninode < n; itable.ninode++){
+    if(left == 0){
+      if((page = kalloc()) == 0)
+        break;
+      left = PGSIZE / sizeof(struct inode);
+    }
+    ip = (struct inode*)page;
+    page += sizeof(struct inode);
+    left--;
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    ip->next = itable.head.next;
+    ip->prev = &itable.head;
+    itable.head.next->prev = ip;
+    itable.head.next = ip;
   }
+  if(itable.ninode < NINODE)
+    panic("iinit");
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void iunreserve(struct inode *ip);
+static void dirdrop(struct inode *dp);
+static void dcset(struct inode *dp, char *name, uint inum);
+static void dcpurge(struct inode *dp);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
@@ -235,7 +404,9 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->ext, ip->ext, sizeof(ip->ext));
+  dip->prealloc = ip->prealloc;
+  dip->xblock = ip->xblock;
   log_write(bp);
   brelse(bp);
 }
@@ -246,27 +417,38 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+      }
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used unreferenced entry.
+  ip = itable.head.prev;
+  if(ip == &itable.head)
     panic("iget: no inodes");
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(ip->inum){
+    for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
 
-  ip = empty;
+  dirdrop(ip);
+  ip->dused = 0;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
@@ -308,7 +490,10 @@ ilock(struct inode *ip)
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->ext, dip->ext, sizeof(ip->ext));
+    ip->prealloc = dip->prealloc;
+    ip->xblock = dip->xblock;
+    ip->hintblk = ip->hintidx = ip->hintbn = 0;
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -338,26 +523,46 @@ iput(struct inode *ip)
 {
   acquire(&itable.lock);
 
-  if(ip->ref == 1 && ip->valid && ip->nlink == 0){
-    // inode has no links and no other references: truncate and free.
-
+  if(ip->ref == 1 && ip->valid && (ip->nlink == 0 || ip->prealloc.len > 0)){
     // ip->ref == 1 means no other process can have ip locked,
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
     release(&itable.lock);
 
-    itrunc(ip);
-    ip->type = 0;
-    iupdate(ip);
-    ip->valid = 0;
+    if(ip->nlink == 0){
+      // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
+      itrunc(ip);
+      ip->type = 0;
+      iupdate(ip);
+      ip->valid = 0;
+    } else {
+      // no one has the file open any more: give back
+      // the blocks reserved for it to grow into.
+      iunreserve(ip);
+      iupdate(ip);
+    }
 
     releasesleep(&ip->lock);
 
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    // keep the entry for a later iget(). a freed
+    // inode is not worth keeping; recycle it first.
+    if(ip->valid){
+      ip->next = itable.head.next;
+      ip->prev = &itable.head;
+    } else {
+      ip->next = &itable.head;
+      ip->prev = itable.head.prev;
+    }
+    ip->next->prev = ip;
+    ip->prev->next = ip;
+  }
   release(&itable.lock);
 }
 
@@ -372,52 +577,149 @@ iunlockput(struct inode *ip)
 // Inode content
 //
 // The content (data) associated with each inode is stored
-// in blocks on the disk. The first NDIRECT block numbers
-// are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// in blocks on the disk, as a list of extents: runs of
+// consecutive blocks. The first NEXTENT extents are in
+// ip->ext[]; the rest are in a chain of extent blocks
+// starting at ip->xblock. Files have no holes, so the
+// extents map file blocks 0, 1, 2, ... in order, and
+// a zero-length extent marks the end of the list.
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If bn is just past the last block, bmap appends one,
+// growing the last extent if the new block follows it.
 // returns 0 if out of disk space.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint blk, idx, base, next, n, addr, xaddr, goal;
+  struct buf *bp, *xbp;
+  struct extent *ext;
+  struct xblock *xb;
+
+  // start from the extent of the last lookup if it
+  // is not past bn; sequential access finds bn there
+  // or close after it.
+  if(bn >= ip->hintbn){
+    blk = ip->hintblk;
+    idx = ip->hintidx;
+    base = ip->hintbn;
+  } else {
+    blk = idx = base = 0;
+  }
 
-  if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[bn] = addr;
+  goal = 0;
+  for(;;){
+    bp = 0;
+    if(blk == 0){
+      ext = ip->ext;
+      n = NEXTENT;
+      next = ip->xblock;
+    } else {
+      bp = bread(ip->dev, blk);
+      xb = (struct xblock*)bp->data;
+      ext = xb->ext;
+      n = XPB;
+      next = xb->next;
     }
-    return addr;
-  }
-  bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
+    for(; idx < n && ext[idx].len > 0; idx++){
+      if(bn < base + ext[idx].len){
+        addr = ext[idx].start + (bn - base);
+        goto found;
+      }
+      base += ext[idx].len;
+      goal = ext[idx].start + ext[idx].len;
     }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
+    if(idx < n || next == 0)
+      break;
+    if(bp)
+      brelse(bp);
+    blk = next;
+    idx = 0;
+  }
+
+  // bn is past the last mapped block.
+  if(bn != base)
+    panic("bmap: hole");
+  // try to put it right after the file's last block.
+  // a regular file takes it from a run of blocks
+  // reserved for it, reserving a new run if it has none,
+  // so that its blocks stay together even when several
+  // files grow at once. the run is smaller as the disk
+  // fills, so that reserved but unwritten blocks never
+  // hold much of the free space.
+  if(ip->type == T_FILE){
+    if(ip->prealloc.len == 0){
+      uint want = nfreeblocks / PREALLOCFRAC;
+      if(want > PREALLOC)
+        want = PREALLOC;
+      if(want == 0)
+        want = 1;
+      ip->prealloc.start = ballocrun(ip->dev, goal, want, &ip->prealloc.len);
+      if(ip->prealloc.start == 0){
+        addr = 0;
+        goto out;
       }
     }
-    brelse(bp);
+    addr = ip->prealloc.start++;
+    ip->prealloc.len--;
+    bzero(ip->dev, addr);
+  } else if((addr = balloc(ip->dev, goal)) == 0){
+    goto out;
+  }
+  if(idx > 0 && ext[idx-1].start + ext[idx-1].len == addr){
+    idx--;
+    base -= ext[idx].len;
+    ext[idx].len++;
+  } else if(idx < n){
+    ext[idx].start = addr;
+    ext[idx].len = 1;
+  } else {
+    // no free extent slots; chain a new extent block.
+    if((xaddr = balloc(ip->dev, addr + 1)) == 0){
+      bfree(ip->dev, addr);
+      addr = 0;
+      goto out;
+    }
+    if(bp)
+      ((struct xblock*)bp->data)->next = xaddr;
+    else
+      ip->xblock = xaddr;
+    if(bp){
+      log_write(bp);
+      brelse(bp);
+    }
+    xbp = bread(ip->dev, xaddr);
+    ((struct xblock*)xbp->data)->ext[0].start = addr;
+    ((struct xblock*)xbp->data)->ext[0].len = 1;
+    log_write(xbp);
+    brelse(xbp);
+    ip->hintblk = xaddr;
+    ip->hintidx = 0;
+    ip->hintbn = base;
     return addr;
   }
+  if(bp)
+    log_write(bp);
+
+found:
+  ip->hintblk = blk;
+  ip->hintidx = idx;
+  ip->hintbn = base;
+out:
+  if(bp)
+    brelse(bp);
+  return addr;
+}
 
-  panic("bmap: out of range");
+// Free the blocks reserved for ip's future growth.
+// Caller must hold ip->lock, and update the inode.
+static void
+iunreserve(struct inode *ip)
+{
+  bfreerun(ip->dev, ip->prealloc.start, ip->prealloc.len);
+  ip->prealloc.start = 0;
+  ip->prealloc.len = 0;
 }
 
 // Truncate inode (discard contents).
@@ -425,28 +727,30 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
+  int i;
+  uint blk, next;
   struct buf *bp;
-  uint *a;
+  struct xblock *xb;
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+  for(i = 0; i < NEXTENT; i++){
+    bfreerun(ip->dev, ip->ext[i].start, ip->ext[i].len);
+    ip->ext[i].start = 0;
+    ip->ext[i].len = 0;
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
+  for(blk = ip->xblock; blk; blk = next){
+    bp = bread(ip->dev, blk);
+    xb = (struct xblock*)bp->data;
+    for(i = 0; i < XPB; i++)
+      bfreerun(ip->dev, xb->ext[i].start, xb->ext[i].len);
+    next = xb->next;
     brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    bfree(ip->dev, blk);
   }
+  ip->xblock = 0;
+  ip->hintblk = ip->hintidx = ip->hintbn = 0;
+  iunreserve(ip);
+  dirdrop(ip);
 
   ip->size = 0;
   iupdate(ip);
@@ -464,6 +768,38 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// A sequential reader will next need block bn.
+// Start reading the READAHEAD blocks from bn on,
+// skipping those before *raend, which were already
+// started, so that the disk works while the reader
+// computes. Updates *raend, the reader's own.
+// Caller must hold ip->lock.
+void
+readahead(struct inode *ip, uint bn, uint *raend)
+{
+  uint end, addr, hintblk, hintidx, hintbn;
+
+  end = bn + READAHEAD;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  if(*raend > bn)
+    bn = *raend;
+  // leave bmap()'s hint where the reader will next look.
+  hintblk = ip->hintblk;
+  hintidx = ip->hintidx;
+  hintbn = ip->hintbn;
+  for(; bn < end; bn++){
+    if((addr = bmap(ip, bn)) == 0)
+      break;
+    if(breadahead(ip->dev, addr) < 0)
+      break;
+  }
+  ip->hintblk = hintblk;
+  ip->hintidx = hintidx;
+  ip->hintbn = hintbn;
+  *raend = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -532,7 +868,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
+  // block to ip->ext[].
   iupdate(ip);
 
   return tot;
@@ -546,17 +882,118 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// A directory larger than a block gets an index the first
+// time it is searched: an open-addressing hash table, in a
+// kalloc()'d page, from names to dirent numbers. Each slot
+// holds 16 bits of the name's hash and the dirent number
+// plus one, or 0 if empty, or DTOMB if deleted. dirlink()
+// and dirunlink() keep it up to date, and dp->dhole lets
+// dirlink() find a free dirent without a scan. The index
+// lives while dp stays in the inode table, and is
+// protected by dp->lock.
+#define NDSLOT (PGSIZE / sizeof(uint))
+#define DTOMB 0xffffffff
+
+static uint
+dhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+static void
+dirdrop(struct inode *dp)
+{
+  if(dp->dindex){
+    kfree(dp->dindex);
+    dp->dindex = 0;
+  }
+}
+
+// Add the dirent at off, named name, to dp's index.
+// If the index is too full, drop it. If deleted slots
+// filled it, the next dirlookup() builds a fresh one;
+// if dp is just too big, it goes without.
+static void
+dirinsert(struct inode *dp, char *name, uint off)
+{
+  uint h, i;
+
+  if(dp->dused + 1 > NDSLOT * 3 / 4){
+    dirdrop(dp);
+    if(dp->size / sizeof(struct dirent) > NDSLOT / 2)
+      dp->dused = -1;
+    return;
+  }
+  h = dhash(name);
+  for(i = h % NDSLOT; dp->dindex[i] != 0 && dp->dindex[i] != DTOMB; i = (i + 1) % NDSLOT)
+    ;
+  if(dp->dindex[i] == 0)
+    dp->dused++;
+  dp->dindex[i] = (h & 0xffff0000) | (off / sizeof(struct dirent) + 1);
+}
+
+// Build dp's index from its dirents.
+static void
+dirindex(struct inode *dp)
+{
+  uint off;
+  struct dirent de;
+
+  if(dp->size / sizeof(de) >= 0xffff){
+    dp->dused = -1;
+    return;
+  }
+  if((dp->dindex = kalloc_zeroed()) == 0)
+    return;
+  dp->dused = 0;
+  dp->dhole = dp->size;
+  for(off = 0; off < dp->size && dp->dindex; off += sizeof(de)){
+    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+      panic("dirindex read");
+    if(de.inum != 0)
+      dirinsert(dp, de.name, off);
+    else if(off < dp->dhole)
+      dp->dhole = off;
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, h, i, s;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if(dp->dindex == 0 && dp->dused >= 0 && dp->size > BSIZE)
+    dirindex(dp);
+
+  if(dp->dindex){
+    h = dhash(name);
+    for(i = h % NDSLOT; (s = dp->dindex[i]) != 0; i = (i + 1) % NDSLOT){
+      if(s == DTOMB || (s & 0xffff0000) != (h & 0xffff0000))
+        continue;
+      off = ((s & 0xffff) - 1) * sizeof(de);
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum != 0 && namecmp(name, de.name) == 0){
+        if(poff)
+          *poff = off;
+        dcset(dp, name, de.inum);
+        return iget(dp->dev, de.inum);
+      }
+    }
+    dcset(dp, name, 0);
+    return 0;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -566,11 +1003,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       // entry matches path element
       if(poff)
         *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+      dcset(dp, name, de.inum);
+      return iget(dp->dev, de.inum);
     }
   }
 
+  dcset(dp, name, 0);
   return 0;
 }
 
@@ -589,8 +1027,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  // Look for an empty dirent, from the first
+  // one that might be empty if dp is indexed.
+  for(off = dp->dindex ? dp->dhole : 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
@@ -602,9 +1041,248 @@ dirlink(struct inode *dp, char *name, uint inum)
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
 
+  dcset(dp, name, inum);
+  if(dp->dindex){
+    dp->dhole = off + sizeof(de);
+    dirinsert(dp, name, off);
+  }
+  return 0;
+}
+
+// Remove the directory entry at off from dp.
+// Returns 0 on success, -1 on failure.
+int
+dirunlink(struct inode *dp, uint off)
+{
+  struct dirent de;
+  uint h, i;
+
+  if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+  h = dhash(de.name);
+  dcset(dp, de.name, 0);
+
+  memset(&de, 0, sizeof(de));
+  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+    return -1;
+
+  if(dp->dindex){
+    for(i = h % NDSLOT; dp->dindex[i] != 0; i = (i + 1) % NDSLOT){
+      if(dp->dindex[i] != DTOMB && (dp->dindex[i] & 0xffff) == off / sizeof(de) + 1){
+        dp->dindex[i] = DTOMB;
+        break;
+      }
+    }
+    if(off < dp->dhole)
+      dp->dhole = off;
+  }
+  return 0;
+}
+
+// Read up to n entries of unlocked directory dp, starting
+// at *off, into ds, along with their inodes' metadata.
+// Advances *off past the entries read, and returns how many
+// there were, or -1 if dp is not a directory.
+int
+dirread(struct inode *dp, uint *off, struct dirstat *ds, int n)
+{
+  struct inode *ip[NGETDENTS];
+  struct dirent de;
+  int i, m;
+
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlock(dp);
+    return -1;
+  }
+  if(n > NGETDENTS)
+    n = NGETDENTS;
+  m = 0;
+  while(m < n && readi(dp, 0, (uint64)&de, *off, sizeof(de)) == sizeof(de)){
+    *off += sizeof(de);
+    if(de.inum == 0)
+      continue;
+    // take the reference while dp is locked, so that
+    // a concurrent unlink can't free the inode.
+    ip[m] = iget(dp->dev, de.inum);
+    memmove(ds[m].name, de.name, DIRSIZ);
+    ds[m].name[DIRSIZ] = 0;
+    m++;
+  }
+  iunlock(dp);
+
+  // lock each inode only once dp is unlocked,
+  // since one of them may be dp, or its parent.
+  // each iput gets its own log operation, since the
+  // last reference to an unlinked inode may free it,
+  // and one operation has room for only one such iput.
+  // the operation costs nothing if nothing is logged.
+  for(i = 0; i < m; i++){
+    ilock(ip[i]);
+    ds[i].inum = ip[i]->inum;
+    ds[i].type = ip[i]->type;
+    ds[i].nlink = ip[i]->nlink;
+    ds[i].size = ip[i]->size;
+    iunlock(ip[i]);
+    begin_op();
+    iput(ip[i]);
+    end_op();
+  }
+  return m;
+}
+
+// Name cache
+
+// The name cache remembers recent dirlookup() results:
+// (dev, directory inum, name) -> inum, where inum 0 means
+// the name is known to be absent. namex() consults it
+// before locking each directory on a path. Entries are
+// only added or changed with the directory locked, by
+// dirlookup(), dirlink() and dirunlink(), so they always
+// agree with the directory's contents. A freed directory's
+// entries are purged before its inum can be reused.
+// dcache.lock protects everything here.
+
+struct dentry {
+  uint dev;
+  uint dir;            // directory inum, or 0 if unused
+  char name[DIRSIZ];
+  uint inum;           // 0 for a negative entry
+  struct dentry *hnext;  // hash chain
+  struct dentry *prev;   // LRU list
+  struct dentry *next;
+};
+
+#define NDHASH 61
+#define DCHASH(dev, dir, name) (((dev)*31 + (dir)*17 + dhash(name)) % NDHASH)
+
+struct {
+  struct spinlock lock;
+  struct dentry dentry[NDENTRY];
+  struct dentry *hash[NDHASH];
+  // Linked list of all entries, through prev/next.
+  // head.next is most recently used.
+  struct dentry head;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++){
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+// Find the entry for name in directory dir, or return 0.
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[DCHASH(dev, dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
   return 0;
 }
 
+// Remove d from its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[DCHASH(d->dev, d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+}
+
+// Move d to the front of the LRU list.
+// Caller must hold dcache.lock.
+static void
+dctouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Record that name in directory dp refers to inum,
+// or, if inum is 0, that there is no such name.
+// Caller must hold dp->lock.
+static void
+dcset(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    // recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dir)
+      dcunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = DCHASH(d->dev, d->dir, d->name);
+    d->hnext = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  dctouch(d);
+  release(&dcache.lock);
+}
+
+// Look up name in directory dp without locking dp.
+// On a hit, return 1 and set *ipp to a referenced inode,
+// or to 0 if the name is known to be absent.
+// Return 0 on a miss. The reference is taken under
+// dcache.lock, so the inode cannot be freed by a
+// concurrent unlink in between.
+static int
+dcget(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dctouch(d);
+  *ipp = d->inum ? iget(d->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Forget every entry for names in directory dp,
+// which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.dentry; d < dcache.dentry+NDENTRY; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dcunhash(d);
+  release(&dcache.lock);
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -659,6 +1337,15 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // only directories have cache entries, so a hit
+    // needs no ilock() to check ip's type.
+    if(!(nameiparent && *path == '\0') && dcget(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -24,9 +24,23 @@ struct superblock {
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
-#define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+// A run of len consecutive disk blocks, starting at start.
+struct extent {
+  uint start;
+  uint len;
+};
+
+#define NEXTENT 5   // extents in the inode
+#define XPB ((BSIZE - 2*sizeof(uint)) / sizeof(struct extent))
+#define MAXFILE (1 << 20)  // in blocks
+
+// Extent block: holds the extents that follow the inode's,
+// and the address of the next extent block, or 0.
+struct xblock {
+  struct extent ext[XPB];
+  uint next;
+  uint unused;
+};
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +49,9 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  struct extent ext[NEXTENT]; // Data blocks, in file order
+  struct extent prealloc;     // Blocks reserved for the file to grow into
+  uint xblock;          // First extent block, or 0
 };
 
 // Inodes per block.
@@ -58,3 +74,12 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory entry and its inode's metadata, as returned by getdents().
+struct dirstat {
+  uint inum;
+  short type;
+  short nlink;
+  uint size;
+  char name[DIRSIZ+1];  // null-terminated
+};
+
@@ -1,6 +1,22 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps a small cache of free pages in front of
+// the global free list, so that most kalloc()/kfree() calls
+// touch only per-CPU state. A CPU refills its cache from the
+// global list, and drains to it, KBATCH pages at a time.
+// A CPU that finds both its cache and the global list empty
+// steals half of another CPU's cache.
+//
+// Idle CPUs also keep a small pool of pre-zeroed pages
+// for kalloc_zeroed(), so that callers that need a clean
+// page don't pay for the memset on the hot path.
+//
+// Pages can be shared copy-on-write by several page tables,
+// so each page has a reference count. kalloc() sets it to one,
+// kdup() increments it, and kfree() only puts the page back
+// on a free list when the count drops to zero.
 
 #include "types.h"
 #include "param.h"
@@ -14,19 +30,38 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// pages moved between a CPU's cache and the global list at once.
+#define KBATCH 32
+
+// maximum number of pages kept in the pre-zeroed pool.
+#define NZEROED 64
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;
+};
+
+struct kmem kmem;        // global free list
+struct kmem kcpu[NCPU];  // per-CPU caches
+struct kmem kzero;       // pre-zeroed pages
+
+// reference counts, indexed by physical page number.
+// updated with atomic instructions rather than a lock.
+#define PA2REF(pa) (&krefs[((uint64)(pa) - KERNBASE) / PGSIZE])
+int krefs[(PHYSTOP - KERNBASE) / PGSIZE];
 
 void
 kinit()
 {
   initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kcpu[i].lock, "kcpu");
+  initlock(&kzero.lock, "kzero");
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +70,131 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    *PA2REF(p) = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Detach up to n pages from the front of km's list
+// and return them as a chain. Caller must hold km->lock.
+static struct run*
+takepages(struct kmem *km, int n)
+{
+  struct run *first, *r;
+  int i;
+
+  first = km->freelist;
+  if(first == 0)
+    return 0;
+  r = first;
+  for(i = 1; i < n && r->next; i++)
+    r = r->next;
+  km->freelist = r->next;
+  km->nfree -= i;
+  r->next = 0;
+  return first;
+}
+
+// Push a chain of pages onto km's list.
+// Caller must hold km->lock.
+static void
+putpages(struct kmem *km, struct run *chain)
+{
+  struct run *last;
+  int n;
+
+  n = 1;
+  for(last = chain; last->next; last = last->next)
+    n++;
+  last->next = km->freelist;
+  km->freelist = chain;
+  km->nfree += n;
+}
+
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference is dropped.
 void
 kfree(void *pa)
 {
-  struct run *r;
+  struct run *r, *chain;
+  struct kmem *kc;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(PA2REF(pa), 1);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
+  r->next = 0;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  kc = &kcpu[cpuid()];
+  chain = 0;
+  acquire(&kc->lock);
+  putpages(kc, r);
+  if(kc->nfree > 2*KBATCH)
+    chain = takepages(kc, KBATCH);
+  release(&kc->lock);
+
+  if(chain){
+    // cache is full; return a batch to the global list.
+    acquire(&kmem.lock);
+    putpages(&kmem, chain);
+    release(&kmem.lock);
+  }
+  pop_off();
+}
+
+// Take up to half of some other CPU's cache.
+// Returns a chain of pages, or 0 if every cache is empty.
+static struct run*
+steal(int id)
+{
+  struct run *chain;
+  struct kmem *victim;
+
+  for(int i = 1; i < NCPU; i++){
+    victim = &kcpu[(id + i) % NCPU];
+    acquire(&victim->lock);
+    chain = takepages(victim, (victim->nfree + 1) / 2);
+    release(&victim->lock);
+    if(chain)
+      return chain;
+  }
+  return 0;
+}
+
+// Pop a page from the pre-zeroed pool, or return 0.
+// The page is returned alone, and all zero.
+static struct run*
+takezeroed(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  r = kzero.freelist;
+  if(r){
+    kzero.freelist = r->next;
+    kzero.nfree--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;  // the only non-zero word.
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -68,15 +203,116 @@ kfree(void *pa)
 void *
 kalloc(void)
 {
-  struct run *r;
+  struct run *r, *chain;
+  struct kmem *kc;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  kc = &kcpu[id];
+
+  acquire(&kc->lock);
+  r = kc->freelist;
+  if(r){
+    kc->freelist = r->next;
+    kc->nfree--;
+  }
+  release(&kc->lock);
 
+  if(r == 0){
+    // refill from the global list, or else from another CPU.
+    // never hold two of these locks at once.
+    acquire(&kmem.lock);
+    chain = takepages(&kmem, KBATCH);
+    release(&kmem.lock);
+    if(chain == 0)
+      chain = steal(id);
+    if(chain == 0)
+      chain = takezeroed();
+    if(chain){
+      r = chain;
+      if(chain->next){
+        acquire(&kc->lock);
+        putpages(kc, chain->next);
+        release(&kc->lock);
+      }
+    }
+  }
+  pop_off();
+
+  if(r)
+    *PA2REF(r) = 1;
+#ifdef KDEBUG
   if(r)
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  return (void*)r;
+}
+
+// Add a reference to an allocated page, e.g. when
+// a copy-on-write fork shares it with a child.
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(PA2REF(pa), 1) < 1)
+    panic("kdup: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return *PA2REF(pa);
+}
+
+// Return the number of free pages.
+// Only a snapshot; other CPUs may be allocating.
+int
+kfreepages(void)
+{
+  int n;
+
+  n = kmem.nfree + kzero.nfree;
+  for(int i = 0; i < NCPU; i++)
+    n += kcpu[i].nfree;
+  return n;
+}
+
+// Allocate one zero-filled page of physical memory.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  if((r = takezeroed()) != 0)
+    return (void*)r;
+  if((r = kalloc()) != 0)
+    memset((char*)r, 0, PGSIZE);
   return (void*)r;
 }
+
+// Called by an idle CPU: zero one free page and add
+// it to the pool used by kalloc_zeroed().
+// Returns 0 if there was nothing to do.
+int
+kzeroidle(void)
+{
+  struct run *r;
+
+  // racy check; the pool size is only a hint.
+  if(kzero.nfree >= NZEROED)
+    return 0;
+  if((r = kalloc()) == 0)
+    return 0;
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&kzero.lock);
+  r->next = kzero.freelist;
+  kzero.freelist = r;
+  kzero.nfree++;
+  release(&kzero.lock);
+  return 1;
+}
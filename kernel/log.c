@@ -6,12 +6,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "proc.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
 // A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
+// calls. The logging system only closes a transaction when there
+// are no FS system calls active in it. Thus there is never
 // any reasoning required about whether a commit might
 // write an uncommitted system call's updates to disk.
 //
@@ -20,21 +21,48 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves log space for the worst case,
+// MAXOPBLOCKS; a call that knows it needs fewer blocks
+// can reserve just those with begin_opn().
+//
+// The log is double-buffered. Closing a transaction copies
+// its blocks into a private snapshot, which is written to the
+// log while new FS system calls add to the next transaction.
+// begin_op() only waits for the copy, which needs no disk I/O.
+// A transaction that closes while another is being written is
+// committed by the same process as soon as the disk is free
+// (group commit), so one commit can carry the work of many
+// end_op()s. An end_op() whose operation wrote anything
+// doesn't return until a header covering it is on disk.
+//
+// Committing only appends to the log. The checkpoint thread
+// later installs committed blocks at their home locations,
+// writing each block once even if several transactions in
+// the log changed it, and then frees their log space.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
+//   header block, containing the oldest committed entry,
+//     the number of committed entries, and the block #
+//     each log block holds
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// The committed entries wrap around the end of the log.
+// mkfs chooses the log's size, which is in the superblock.
+// Log appends are synchronous, but the blocks of one
+// append go to the disk as a single request.
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// and to keep track in memory of logged block#s.
+// For the open transaction, block[i] is its i'th block.
+// For the committed log, block[i] is the block in log block i+1,
+// and entries head .. head+n-1 (mod the log size) are valid.
 struct logheader {
+  int head;
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOGSIZE-1];
 };
 
 struct log {
@@ -42,18 +70,45 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they have reserved.
+  int committing;  // a transaction is being written.
+  int copying;     // commit() is taking a snapshot, please wait.
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction.
+  uint64 seq;      // the open transaction's number.
+  uint64 done;     // the last transaction whose header is on disk.
+  struct logheader clh; // committed, not yet installed.
+  int durable;     // entries of clh whose header is on disk.
+  uint64 nfreed;   // entries ever freed by the checkpointer.
+  int unsafe;      // log blocks freed, but not yet on disk.
+  int needspace;   // commit() is waiting for the checkpoint.
+  struct buf snap[MAXLOGSIZE-1];  // log blocks' contents, not in the cache.
+  struct buf *cbuf[MAXLOGSIZE-1]; // their pinned cache blocks.
+  // lists of blocks to write at once, kept here rather
+  // than on the kernel stack. only the committer uses
+  // wlist, and only the checkpointer (or recovery) ilist.
+  struct buf *wlist[MAXLOGSIZE-1];
+  struct buf *ilist[MAXLOGSIZE-1];
+
+  // statistics, for choosing the log size.
+  uint64 nwrite;   // log_write() calls.
+  uint64 nabsorb;  // ... for blocks already in the transaction.
+  uint64 ncommit;  // transactions committed.
+  uint64 nblock;   // blocks committed.
+  uint64 ninstall; // blocks installed.
+  int maxn;        // largest transaction.
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void checkpointer(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
+  char *mem = 0;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -61,25 +116,83 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.seq = 1;
+  if (log.size < 2 || log.size > MAXLOGSIZE)
+    panic("initlog: bad log size");
+  for (int i = 0; i < log.size - 1; i++) {
+    if (i % (PGSIZE / BSIZE) == 0 && (mem = kalloc()) == 0)
+      panic("initlog: kalloc");
+    initsleeplock(&log.snap[i].lock, "logsnap");
+    log.snap[i].dev = dev;
+    log.snap[i].data = (uchar*)mem + (i % (PGSIZE / BSIZE)) * BSIZE;
+  }
   recover_from_log();
+  kthread(checkpointer, "checkpoint");
+}
+
+// Is the log entry at pos overwritten by a later
+// one among the first m from head?
+static int
+superseded(int head, int m, int pos)
+{
+  int cap = log.size - 1;
+
+  for (int i = (pos - head + cap) % cap + 1; i < m; i++) {
+    if (log.clh.block[(head + i) % cap] == log.clh.block[pos])
+      return 1;
+  }
+  return 0;
 }
 
-// Copy committed blocks from log to their home location
+// Copy the m committed blocks from head on to their home
+// locations, from the snapshot, or when recovering, from
+// the log on disk. Only the latest copy of each block
+// is written.
 static void
-install_trans(int recovering)
+install_trans(int head, int m, int recovering)
 {
-  int tail;
+  int cap = log.size - 1;
+  int tail, nb = 0;
+  struct buf **dbuf = log.ilist;
+
+  for (tail = 0; tail < m; tail++) {
+    int pos = (head + tail) % cap;
+    struct buf *b;
+    if (superseded(head, m, pos))
+      continue;
+    if (recovering) {
+      struct buf *lbuf = bread(log.dev, log.start+pos+1); // read log block
+      b = bread(log.dev, log.clh.block[pos]); // read dst
+      memmove(b->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    } else {
+      b = &log.snap[pos];
+      acquiresleep(&b->lock);
+      b->blockno = log.clh.block[pos];
+    }
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+    // keep dbuf sorted by block number, so that
+    // neighbouring blocks go to disk in one request.
+    int i;
+    for (i = nb; i > 0 && dbuf[i-1]->blockno > b->blockno; i--)
+      dbuf[i] = dbuf[i-1];
+    dbuf[i] = b;
+    nb++;
   }
+  bwritev(dbuf, nb);  // write dsts to disk
+  for (tail = 0; tail < nb; tail++) {
+    if (recovering)
+      brelse(dbuf[tail]);
+    else
+      releasesleep(&dbuf[tail]->lock);
+  }
+  if (!recovering) {
+    // the home blocks are up to date, so the
+    // cache may now evict them.
+    for (tail = 0; tail < m; tail++)
+      bunpin(log.cbuf[(head + tail) % cap]);
+  }
+  log.ninstall += nb;
 }
 
 // Read the log header from disk into the in-memory log header
@@ -89,27 +202,40 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.clh.head = lh->head;
+  log.clh.n = lh->n;
+  for (i = 0; i < log.size - 1; i++) {
+    log.clh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the committed log's header to disk.
+// Writing a header that covers a transaction
+// is the true point at which it commits, so only
+// then does log.durable count it.
+// Writers are serialized by the header buf's lock,
+// so the last one to write has the latest header.
 static void
 write_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  int i, n;
+  uint64 freed;
+  acquire(&log.lock);
+  hb->head = log.clh.head;
+  hb->n = n = log.clh.n;
+  freed = log.nfreed;
+  for (i = 0; i < log.size - 1; i++) {
+    hb->block[i] = log.clh.block[i];
   }
+  release(&log.lock);
   bwrite(buf);
+  acquire(&log.lock);
+  // the checkpointer may have freed entries since the copy.
+  log.durable = n - (log.nfreed - freed);
+  release(&log.lock);
   brelse(buf);
 }
 
@@ -117,8 +243,12 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  if (log.clh.head < 0 || log.clh.head >= log.size - 1 ||
+      log.clh.n < 0 || log.clh.n > log.size - 1)
+    panic("recover_from_log: bad header");
+  install_trans(log.clh.head, log.clh.n, 1); // if committed, copy from log to disk
+  log.clh.head = 0;
+  log.clh.n = 0;
   write_head(); // clear the log
 }
 
@@ -126,15 +256,29 @@ recover_from_log(void)
 void
 begin_op(void)
 {
+  begin_opn(MAXOPBLOCKS);
+}
+
+// called at the start of an FS system call that
+// will write at most n distinct blocks.
+void
+begin_opn(int n)
+{
+  if(n > MAXOPBLOCKS)
+    panic("begin_opn");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.copying){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size - 1){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
+      myproc()->logwrote = 0;
       release(&log.lock);
       break;
     }
@@ -142,17 +286,23 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation,
+// unless another process is committing, in which case
+// that process will commit this transaction too.
+// if the operation wrote anything, waits until it
+// has been committed, whoever commits it.
 void
 end_op(void)
 {
   int do_commit = 0;
+  uint64 seq;
 
   acquire(&log.lock);
+  seq = log.seq;
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
+  if(log.outstanding == 0 && log.lh.n > 0 && !log.committing){
     do_commit = 1;
     log.committing = 1;
   } else {
@@ -167,44 +317,159 @@ end_op(void)
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+  } else if(myproc()->logwrote){
     acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+    while(log.done < seq)
+      sleep(&log.done, &log.lock);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the n blocks of the closed transaction, which go
+// in log entries first on, from the cache into the snapshot.
+// They are pinned, so this reads nothing from disk.
+// The cache blocks stay pinned until installed,
+// since until then their home locations are stale.
+static void
+snapshot(int first, int n)
+{
+  int cap = log.size - 1;
+
+  for (int i = 0; i < n; i++) {
+    int pos = (first + i) % cap;
+    struct buf *b = bread(log.dev, log.clh.block[pos]);
+    acquiresleep(&log.snap[pos].lock);
+    memmove(log.snap[pos].data, b->data, BSIZE);
+    log.cbuf[pos] = b;
+    brelse(b);
+  }
+}
+
+// Write the snapshot of the n log entries from first on
+// to the log.
 static void
-write_log(void)
+write_log(int first, int n)
 {
+  int cap = log.size - 1;
   int tail;
+  struct buf **to = log.wlist;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < n; tail++) {
+    int pos = (first + tail) % cap;
+    to[tail] = &log.snap[pos];
+    to[tail]->blockno = log.start+pos+1; // log block
   }
+  bwritev(to, n);  // write the log, in one request
+  for (tail = 0; tail < n; tail++)
+    releasesleep(&to[tail]->lock);
 }
 
+// Commit the open transaction, and then any transaction
+// that closes while this one is being written.
+// Caller has set log.committing.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+  int cap = log.size - 1;
+  int first, n;
+  uint64 seq;
+
+  acquire(&log.lock);
+  while (log.outstanding == 0 && log.lh.n > 0) {
+    if (cap - log.clh.n - log.unsafe < log.lh.n) {
+      // the log is full of blocks that have not been
+      // installed yet; wait for the checkpoint thread.
+      log.needspace = 1;
+      wakeup(&log.clh);
+      sleep(&log.needspace, &log.lock);
+      continue;
+    }
+
+    // close the transaction, and give it the log
+    // entries after the committed ones. FS system calls
+    // can't start until its blocks have been copied.
+    first = (log.clh.head + log.clh.n) % cap;
+    n = log.lh.n;
+    for (int i = 0; i < n; i++)
+      log.clh.block[(first + i) % cap] = log.lh.block[i];
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    seq = log.seq++;
+    log.copying = 1;
+    log.ncommit++;
+    log.nblock += n;
+    if(n > log.maxn)
+      log.maxn = n;
+    release(&log.lock);
+
+    snapshot(first, n);
+
+    acquire(&log.lock);
+    log.copying = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log(first, n);  // Write snapshot to log
+    acquire(&log.lock);
+    log.clh.n += n;
+    release(&log.lock);
+    write_head();    // Write header to disk -- the real commit
+
+    acquire(&log.lock);
+    log.done = seq;
+    wakeup(&log.done);
+    if (log.clh.n > cap / 2)
+      wakeup(&log.clh);   // time to checkpoint
+  }
+  log.committing = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// The checkpoint thread. Once the log is half full, or a
+// commit is waiting for room, install the committed blocks
+// at their home locations and free their log entries.
+// Waiting lets it skip blocks that later transactions change.
+// It installs only transactions whose header is on disk;
+// a crash must not leave home blocks changed by one that
+// recovery won't replay.
+static void
+checkpointer(void)
+{
+  int cap = log.size - 1;
+  int head, m;
+
+  acquire(&log.lock);
+  for(;;){
+    while (log.durable == 0 || (log.clh.n <= cap / 2 && !log.needspace))
+      sleep(&log.clh, &log.lock);
+    head = log.clh.head;
+    m = log.durable;
+    release(&log.lock);
+
+    install_trans(head, m, 0);
+
+    // free the entries. commit() must not reuse them
+    // until the header that frees them is on disk, or
+    // a crash would replay the new contents as the old.
+    acquire(&log.lock);
+    log.clh.head = (head + m) % cap;
+    log.clh.n -= m;
+    log.durable -= m;
+    log.nfreed += m;
+    log.unsafe = m;
+    release(&log.lock);
+    write_head();
+    acquire(&log.lock);
+    log.unsafe = 0;
+    log.needspace = 0;
+    wakeup(&log.needspace);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will write it to the log, and
+// the checkpoint thread to its home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,14 +482,18 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
+  log.nwrite++;
+  myproc()->logwrote = 1;
   for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+    if (log.lh.block[i] == b->blockno) {  // log absorption
+      log.nabsorb++;
       break;
+    }
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
@@ -234,3 +503,13 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+// Print log statistics. For ^P on the console.
+// No lock to avoid wedging a stuck machine further.
+void
+logstats(void)
+{
+  printf("log: %d blocks, %ld writes, %ld absorbed, %ld commits, "
+         "%ld blocks committed, largest %d, %ld installed\n",
+         log.size - 1, log.nwrite, log.nabsorb, log.ncommit,
+         log.nblock, log.maxn, log.ninstall);
+}
@@ -6,13 +6,20 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum size of the i-node table
+#define ICACHEFRAC  256  // i-node table gets 1/ICACHEFRAC of free memory
+#define NDENTRY     256  // size of the path name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      (MAXOPBLOCKS*3)  // min blocks in on-disk log
+#define MAXLOGSIZE   254  // max blocks in on-disk log; header fills a block
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHEFRAC   16  // disk block cache gets 1/BCACHEFRAC of free memory
+#define READAHEAD     4  // blocks read ahead of a sequential reader
+#define PREALLOC     16  // blocks reserved at once for a growing file
+#define PREALLOCFRAC 64  // ... but no more than 1/PREALLOCFRAC of the free blocks
 #ifdef LAB_FS
 #define FSSIZE       200000  // size of file system in blocks
 #else
@@ -23,6 +30,12 @@
 #endif
 #endif
 #define MAXPATH      128   // maximum file path name
+#define NGETDENTS    16    // max directory entries per getdents()
+#define TIMEBASE     10000000  // time CSR ticks per second
+#define TICKTIME     (TIMEBASE/10)  // time between clock ticks
+#define QUANTUM      TICKTIME  // time a process runs before it must yield
+#define MINNICE      (-20)  // highest scheduling priority
+#define MAXNICE      19     // lowest scheduling priority
 
 #ifdef LAB_UTIL
 #define USERSTACK    2     // user stack pages
@@ -12,6 +12,134 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Each CPU has a queue of RUNNABLE processes. A process
+// joins the queue of the CPU it last ran on, unless that
+// CPU is idle, and a CPU whose queue is empty steals from
+// another's. Lock order is p->lock, then a queue's lock.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;
+  uint64 minvrun;   // no queued process's vruntime is below this
+} runq[NCPU];
+
+// A scheduling class decides the order in which the
+// processes on a run queue get to run. Callers hold
+// the queue's lock, and p->lock for enqueue and charge.
+struct schedclass {
+  char *name;
+  void (*enqueue)(struct runq*, struct proc*);
+  struct proc *(*dequeue)(struct runq*);
+  void (*charge)(struct proc*, uint64);  // p ran for this long
+};
+
+// Round robin: a FIFO queue.
+
+static void
+rrenqueue(struct runq *q, struct proc *p)
+{
+  p->rqnext = 0;
+  if(q->tail)
+    q->tail->rqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+}
+
+static struct proc*
+rrdequeue(struct runq *q)
+{
+  struct proc *p;
+
+  if((p = q->head) != 0){
+    q->head = p->rqnext;
+    if(q->head == 0)
+      q->tail = 0;
+  }
+  return p;
+}
+
+static void
+rrcharge(struct proc *p, uint64 t)
+{
+}
+
+struct schedclass rrclass = { "rr", rrenqueue, rrdequeue, rrcharge };
+
+// Fair share, in the manner of stride scheduling: each
+// process's vruntime grows as it runs, more slowly the
+// higher its weight, and the queue runs the process with
+// the least vruntime first. A process that has been asleep
+// or was just created starts at the queue's minvrun, so it
+// runs soon but gets no credit for the time it didn't run.
+// Weights for nice -20 to 19; each step is about 10% of the
+// CPU. Nice 0 is NICE0WEIGHT.
+
+#define NICE0WEIGHT 1024
+
+static int weights[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+  9548, 7620, 6100, 4904, 3906,
+  3121, 2501, 1991, 1586, 1277,
+  1024, 820, 655, 526, 423,
+  335, 272, 215, 172, 137,
+  110, 87, 70, 56, 45,
+  36, 29, 23, 18, 15,
+};
+
+static void
+fairenqueue(struct runq *q, struct proc *p)
+{
+  struct proc **pp;
+
+  if(p->vruntime < q->minvrun)
+    p->vruntime = q->minvrun;
+  for(pp = &q->head; *pp && (*pp)->vruntime <= p->vruntime; pp = &(*pp)->rqnext)
+    ;
+  p->rqnext = *pp;
+  *pp = p;
+  if(p->rqnext == 0)
+    q->tail = p;
+}
+
+static struct proc*
+fairdequeue(struct runq *q)
+{
+  struct proc *p;
+
+  if((p = rrdequeue(q)) != 0 && p->vruntime > q->minvrun)
+    q->minvrun = p->vruntime;
+  return p;
+}
+
+static void
+faircharge(struct proc *p, uint64 t)
+{
+  p->vruntime += t * NICE0WEIGHT / weights[p->nice - MINNICE];
+}
+
+struct schedclass fairclass = { "fair", fairenqueue, fairdequeue, faircharge };
+
+// the class in use; rrclass runs processes in turn.
+struct schedclass *sclass = &fairclass;
+
+// number of CPUs running a process.
+int nbusy;
+
+// Sleeping processes, hashed by the channel they sleep on,
+// so that wakeup() need only look at one bucket. Lock order
+// is the lock passed to sleep(), then a bucket's lock, then
+// p->lock.
+#define NSLEEPQ 61
+#define SLEEPHASH(chan) (((uint64)(chan) / 8) % NSLEEPQ)
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
@@ -51,6 +179,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -124,6 +256,7 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -165,9 +298,12 @@ freeproc(struct proc *p)
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->nice = 0;
+  p->vruntime = 0;
   p->state = UNUSED;
 }
 
@@ -228,6 +364,60 @@ uchar initcode[] = {
   0x00, 0x00, 0x00, 0x00
 };
 
+// Mark p RUNNABLE and add it to the run queue
+// of the CPU it last ran on. If that CPU is idle,
+// it may not look at its queue for a long time,
+// so use this CPU's instead.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct runq *q = &runq[p->cpu];
+
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  if(cpus[p->cpu].idle && p->cpu != cpuid()){
+    release(&q->lock);
+    q = &runq[cpuid()];
+    acquire(&q->lock);
+  }
+  sclass->enqueue(q, p);
+  q->n++;
+  release(&q->lock);
+}
+
+// Remove and return the process at the head of q, or 0.
+static struct proc*
+runqpop(struct runq *q)
+{
+  struct proc *p;
+
+  acquire(&q->lock);
+  if((p = sclass->dequeue(q)) != 0)
+    q->n--;
+  release(&q->lock);
+  return p;
+}
+
+// Choose a process for CPU id to run: the next on its own
+// queue, or else one stolen from another CPU's.
+static struct proc*
+pickproc(int id)
+{
+  struct proc *p;
+
+  if((p = runqpop(&runq[id])) != 0)
+    return p;
+  for(int i = 1; i < NCPU; i++){
+    // racy check, so as not to take idle CPUs' locks.
+    if(runq[(id + i) % NCPU].n == 0)
+      continue;
+    if((p = runqpop(&runq[(id + i) % NCPU])) != 0)
+      return p;
+  }
+  return 0;
+}
+
 // Set up first user process.
 void
 userinit(void)
@@ -249,8 +439,36 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
+
+  release(&p->lock);
+}
+
+// A kernel thread starts here, from the scheduler.
+static void
+kthreadstart(void)
+{
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  myproc()->kfn();
+  panic("kthread returned");
+}
+
+// Create a kernel thread: a process that runs fn
+// in the kernel and never returns to user space.
+// fn must not return.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
 
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
   release(&p->lock);
 }
 
@@ -288,7 +506,7 @@ fork(void)
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Share user memory copy-on-write with the child.
   if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
     freeproc(np);
     release(&np->lock);
@@ -310,6 +528,11 @@ fork(void)
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
+  // only p, or the scheduler while p isn't running,
+  // changes these.
+  np->nice = p->nice;
+  np->vruntime = p->vruntime;
+
   pid = np->pid;
 
   release(&np->lock);
@@ -319,7 +542,7 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
@@ -434,10 +657,43 @@ wait(uint64 addr)
   }
 }
 
+// Nothing to run: stop this CPU until an interrupt.
+// Only program the timer for the next sleeper's deadline,
+// or, while other CPUs are busy, for a poll of their queues
+// one quantum from now, since there is no way to interrupt
+// this CPU when they queue more work. A device interrupt
+// wakes all idle CPUs.
+static void
+idle(struct cpu *c, int id)
+{
+  struct runq *q = &runq[id];
+
+  // wfi returns when an interrupt is pending even with
+  // interrupts off, so one that arrives between the check
+  // below and the wfi isn't missed.
+  intr_off();
+  acquire(&q->lock);
+  if(q->head){
+    release(&q->lock);
+    return;
+  }
+  c->idle = 1;
+  release(&q->lock);
+
+  c->nexttick = nbusy > 0 ? r_time() + QUANTUM : ~0UL;
+  w_stimecmp(timernext(c->nexttick));
+  asm volatile("wfi");
+
+  acquire(&q->lock);
+  c->idle = 0;
+  release(&q->lock);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or another's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,6 +702,7 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
 
   c->proc = 0;
   for(;;){
@@ -454,28 +711,34 @@ scheduler(void)
     // processes are waiting.
     intr_on();
 
-    int found = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
+    if((p = pickproc(id)) != 0) {
+      // p may have just been queued by a CPU that is still
+      // switching away from it; acquiring p->lock waits
+      // until that CPU's scheduler has released it.
       acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found = 1;
-      }
+      if(p->state != RUNNABLE)
+        panic("scheduler: not runnable");
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      p->cpu = id;
+      c->proc = p;
+      // give p a full quantum.
+      c->nexttick = r_time() + QUANTUM;
+      w_stimecmp(timernext(c->nexttick));
+      __sync_fetch_and_add(&nbusy, 1);
+      p->runstart = r_time();
+      swtch(&c->context, &p->context);
+      __sync_fetch_and_sub(&nbusy, 1);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
       release(&p->lock);
-    }
-    if(found == 0) {
-      // nothing to run; stop running on this core until an interrupt.
-      intr_on();
-      asm volatile("wfi");
+    } else if(kzeroidle() == 0) {
+      // nothing to run, and no free pages left to pre-zero.
+      idle(c, id);
     }
   }
 }
@@ -507,13 +770,27 @@ sched(void)
   mycpu()->intena = intena;
 }
 
+// Charge p's class for the time it has run since it
+// was dispatched. Must hold p->lock, and be called
+// before p goes back on a run queue, whose order may
+// depend on what was charged.
+static void
+charge(struct proc *p)
+{
+  uint64 now = r_time();
+
+  sclass->charge(p, now - p->runstart);
+  p->runstart = now;
+}
+
 // Give up the CPU for one scheduling round.
 void
 yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  charge(p);
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -548,20 +825,28 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = &sleepq[SLEEPHASH(chan)];
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once p is on chan's sleep queue, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
-  // so it's okay to release lk.
+  // (wakeup searches the queue),
+  // so it's okay to release lk. wakeup locks
+  // p->lock, so it can't make p RUNNABLE before
+  // sched() has switched away from it.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
+  charge(p);
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = q->head;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
@@ -578,17 +863,20 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *q = &sleepq[SLEEPHASH(chan)];
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-    }
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    acquire(&p->lock);
+    if(p->chan == chan) {
+      *pp = p->sqnext;
+      setrunnable(p);
+    } else
+      pp = &p->sqnext;
+    release(&p->lock);
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -598,16 +886,19 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
+      chan = p->state == SLEEPING ? p->chan : 0;
       release(&p->lock);
+      // Wake process from sleep(). wakeup() takes the
+      // sleep queue's lock, which must come before p->lock;
+      // others sleeping on chan will just check and sleep again.
+      if(chan)
+        wakeup(chan);
       return 0;
     }
     release(&p->lock);
@@ -615,6 +906,26 @@ kill(int pid)
   return -1;
 }
 
+// Add inc to the calling process's nice value,
+// keeping it between MINNICE and MAXNICE.
+// Returns the new value.
+int
+nice(int inc)
+{
+  struct proc *p = myproc();
+  int n;
+
+  acquire(&p->lock);
+  n = p->nice + inc;
+  if(n < MINNICE)
+    n = MINNICE;
+  if(n > MAXNICE)
+    n = MAXNICE;
+  p->nice = n;
+  release(&p->lock);
+  return n;
+}
+
 void
 setkilled(struct proc *p)
 {
@@ -24,6 +24,8 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 nexttick;            // time of this CPU's next clock tick
+  int idle;                   // waiting in wfi; protected by its run queue's lock
 };
 
 extern struct cpu cpus[NCPU];
@@ -91,6 +93,21 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU it last ran on, whose run queue it joins
+  int nice;                    // Scheduling priority, MINNICE (highest) to MAXNICE
+  uint64 vruntime;             // Weighted run time, for the fair scheduling class;
+                               // also read under its run queue's lock while queued
+  uint64 runstart;             // When it was last dispatched, or last charged
+
+  // its run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process on the run queue
+
+  // its sleep queue's lock must be held when using this:
+  struct proc *sqnext;         // Next process sleeping in the same bucket
+
+  // the timers lock must be held when using these:
+  uint64 deadline;             // When timersleep() should return
+  int tindex;                  // Index in the timer heap, or -1
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -103,5 +120,8 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int logres;                  // Log blocks reserved by begin_opn()
+  int logwrote;                // Called log_write() since begin_opn()
+  void (*kfn)(void);           // Kernel thread's function, or 0
   char name[16];               // Process name (debugging)
 };
@@ -62,5 +62,5 @@ timerinit()
   w_mcounteren(r_mcounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKTIME);
 }
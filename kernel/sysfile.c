@@ -119,6 +119,20 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+uint64
+sys_getdents(void)
+{
+  struct file *f;
+  int n;
+  uint64 ds; // user pointer to array of struct dirstat
+
+  argaddr(1, &ds);
+  argint(2, &n);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filegetdents(f, ds, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -189,7 +203,6 @@ uint64
 sys_unlink(void)
 {
   struct inode *ip, *dp;
-  struct dirent de;
   char name[DIRSIZ], path[MAXPATH];
   uint off;
 
@@ -219,8 +232,7 @@ sys_unlink(void)
     goto bad;
   }
 
-  memset(&de, 0, sizeof(de));
-  if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+  if(dirunlink(dp, off) < 0)
     panic("unlink: writei");
   if(ip->type == T_DIR){
     dp->nlink--;
@@ -355,6 +367,8 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = 0;
+    f->ranext = 0;
+    f->raend = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
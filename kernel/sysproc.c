@@ -40,11 +40,20 @@ sys_sbrk(void)
 {
   uint64 addr;
   int n;
+  struct proc *p = myproc();
 
   argint(0, &n);
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
+  addr = p->sz;
+  if(n < 0){
+    if(growproc(n) < 0)
+      return -1;
+  } else {
+    // grow lazily; vmfault() allocates each page
+    // when the process first touches it.
+    if(addr + n < addr || addr + n > TRAPFRAME)
+      return -1;
+    p->sz += n;
+  }
   return addr;
 }
 
@@ -52,22 +61,23 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return timersleep(r_time() + (uint64)n * TICKTIME);
+}
+
+// sleep for n microseconds.
+uint64
+sys_usleep(void)
+{
+  int n;
+
+  argint(0, &n);
+  if(n < 0)
+    n = 0;
+  return timersleep(r_time() + (uint64)n * (TIMEBASE / 1000000));
 }
 
 uint64
@@ -79,15 +89,22 @@ sys_kill(void)
   return kill(pid);
 }
 
-// return how many clock tick interrupts have occurred
-// since start.
+// change the calling process's scheduling priority by n,
+// and return the new nice value.
 uint64
-sys_uptime(void)
+sys_nice(void)
 {
-  uint xticks;
+  int n;
 
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  argint(0, &n);
+  return nice(n);
+}
+
+// return how many clock ticks have passed since start.
+// idle CPUs take no clock interrupts, so count them
+// with the time CSR rather than in clockintr().
+uint64
+sys_uptime(void)
+{
+  return r_time() / TICKTIME;
 }
@@ -0,0 +1,136 @@
+//
+// Timed sleeps.
+//
+// A process in timersleep() is kept in a min-heap ordered by
+// its deadline, in units of the time CSR. clockintr() calls
+// timerexpire() to wake each process whose deadline has
+// passed, and asks for its next interrupt no later than the
+// earliest remaining deadline, so a sleeper is woken once,
+// at its expiry, rather than on every tick.
+//
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct {
+  struct spinlock lock;
+  int n;
+  struct proc *heap[NPROC];  // heap[0] has the earliest deadline
+} timers;
+
+void
+timersinit(void)
+{
+  initlock(&timers.lock, "timers");
+}
+
+static void
+place(struct proc *p, int i)
+{
+  timers.heap[i] = p;
+  p->tindex = i;
+}
+
+// Move the entry at i up or down until the heap is ordered.
+static void
+fix(int i)
+{
+  struct proc *p = timers.heap[i];
+  int c;
+
+  while(i > 0 && timers.heap[(i-1)/2]->deadline > p->deadline){
+    place(timers.heap[(i-1)/2], i);
+    i = (i-1)/2;
+  }
+  for(;;){
+    c = 2*i + 1;
+    if(c >= timers.n)
+      break;
+    if(c+1 < timers.n && timers.heap[c+1]->deadline < timers.heap[c]->deadline)
+      c++;
+    if(timers.heap[c]->deadline >= p->deadline)
+      break;
+    place(timers.heap[c], i);
+    i = c;
+  }
+  place(p, i);
+}
+
+// Take p out of the heap.
+static void
+removetimer(struct proc *p)
+{
+  int i = p->tindex;
+
+  timers.n--;
+  if(i != timers.n){
+    place(timers.heap[timers.n], i);
+    fix(i);
+  }
+  p->tindex = -1;
+}
+
+// Return the earlier of t and the earliest deadline.
+// Only a hint, read without the lock.
+uint64
+timernext(uint64 t)
+{
+  struct proc *p;
+
+  if(timers.n > 0 && (p = timers.heap[0]) != 0 && p->deadline < t)
+    return p->deadline;
+  return t;
+}
+
+// Sleep until the time CSR reaches deadline.
+// Returns 0, or -1 if the process was killed.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  if(r_time() >= deadline)
+    return 0;
+
+  acquire(&timers.lock);
+  p->deadline = deadline;
+  place(p, timers.n++);
+  fix(p->tindex);
+  // this hart's next interrupt may be too late.
+  w_stimecmp(timernext(mycpu()->nexttick));
+
+  while(p->tindex >= 0){
+    if(killed(p)){
+      removetimer(p);
+      release(&timers.lock);
+      return -1;
+    }
+    sleep(&p->deadline, &timers.lock);
+  }
+  release(&timers.lock);
+  return 0;
+}
+
+// Wake every process whose deadline has passed.
+// Called from clockintr().
+void
+timerexpire(void)
+{
+  struct proc *p;
+  uint64 now = r_time();
+
+  // racy check, to skip the lock on most interrupts.
+  if(timernext(now + 1) > now)
+    return;
+
+  acquire(&timers.lock);
+  while(timers.n > 0 && (p = timers.heap[0])->deadline <= now){
+    removetimer(p);
+    wakeup(&p->deadline);
+  }
+  release(&timers.lock);
+}
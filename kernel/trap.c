@@ -6,9 +6,6 @@
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
-uint ticks;
-
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -16,12 +13,6 @@ void kernelvec();
 
 extern int devintr();
 
-void
-trapinit(void)
-{
-  initlock(&tickslock, "time");
-}
-
 // set up to take exceptions and traps while in the kernel.
 void
 trapinithart(void)
@@ -65,6 +56,10 @@ usertrap(void)
     intr_on();
 
     syscall();
+  } else if((r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // page fault on lazily allocated heap or on a
+    // copy-on-write page; the page is now mapped.
   } else if((which_dev = devintr()) != 0){
     // ok
   } else {
@@ -76,7 +71,7 @@ usertrap(void)
   if(killed(p))
     exit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if this is a clock tick.
   if(which_dev == 2)
     yield();
 
@@ -150,7 +145,7 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if this is a clock tick.
   if(which_dev == 2 && myproc() != 0)
     yield();
 
@@ -160,26 +155,35 @@ kerneltrap()
   w_sstatus(sstatus);
 }
 
-void
+// Returns 1 if this interrupt is a clock tick, or 0 if
+// it came early only to wake a sleeping process.
+// There are no ticks while a CPU is idle.
+int
 clockintr()
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
+  struct cpu *c = mycpu();
+  int tick = 0;
+
+  if(r_time() >= c->nexttick){
+    // the running process's quantum is up. an idle CPU
+    // reprograms the timer itself; see idle() in proc.c.
+    c->nexttick = r_time() + QUANTUM;
+    tick = 1;
   }
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  timerexpire();
+
+  // ask for the next timer interrupt: at the next tick, or
+  // earlier if a sleeping process must be woken before that.
+  // this also clears the interrupt request.
+  w_stimecmp(timernext(c->nexttick));
+  return tick;
 }
 
 // check if it's an external interrupt or software interrupt,
 // and handle it.
-// returns 2 if timer interrupt,
-// 1 if other device,
+// returns 2 if clock tick,
+// 1 if other device or early timer interrupt,
 // 0 if not recognized.
 int
 devintr()
@@ -209,8 +213,7 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000005L){
     // timer interrupt.
-    clockintr();
-    return 2;
+    return clockintr() ? 2 : 1;
   } else {
     return 0;
   }
@@ -19,12 +19,15 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// max blocks moved by one request.
+#define MAXSEG 16
+
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
-  // most commands consist of a "chain" (a linked list) of a couple of
-  // these descriptors.
+  // each command uses one of them, which points to an
+  // indirect table of three more (see ind below).
   struct virtq_desc *desc;
 
   // a ring in which the driver writes descriptor numbers
@@ -46,13 +49,18 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXSEG];  // consecutive blocks
+    int n;
     char status;
+    char async;   // nobody waits; hand the bufs to bdone().
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // indirect descriptor tables, one per descriptor.
+  struct virtq_desc ind[NUM][MAXSEG+2] __attribute__((aligned(16)));
   
   struct spinlock vdisk_lock;
   
@@ -91,7 +99,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
+  if(!(features & (1 << VIRTIO_RING_F_INDIRECT_DESC)))
+    panic("virtio disk has no indirect descriptors");
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
 
   // tell device that feature negotiation is complete.
@@ -118,14 +127,11 @@ virtio_disk_init(void)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
+  disk.desc = kalloc_zeroed();
+  disk.avail = kalloc_zeroed();
+  disk.used = kalloc_zeroed();
   if(!disk.desc || !disk.avail || !disk.used)
     panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
 
   // set queue size.
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
@@ -181,61 +187,25 @@ free_desc(int i)
   wakeup(&disk.free[0]);
 }
 
-// free a chain of descriptors.
+// format descriptor i and its indirect table for a transfer
+// of the n bufs in bs, which hold consecutive blocks, and put
+// it on the avail ring. the caller must then notify the device.
+// caller holds disk.vdisk_lock.
 static void
-free_chain(int i)
+submit(struct buf **bs, int n, int write, int i, int async)
 {
-  while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
-    if(flag & VRING_DESC_F_NEXT)
-      i = nxt;
-    else
-      break;
-  }
-}
-
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
-static int
-alloc3_desc(int *idx)
-{
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
-  return 0;
-}
-
-void
-virtio_disk_rw(struct buf *b, int write)
-{
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  struct virtq_desc *ind = disk.ind[i];
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // a descriptor for type/reserved/sector, descriptors for the
+  // data, and one for a 1-byte status result. they go in an
+  // indirect table, so each request takes one ring descriptor.
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &disk.ops[i];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,32 +214,43 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  ind[0].addr = (uint64) buf0;
+  ind[0].len = sizeof(struct virtio_blk_req);
+  ind[0].flags = VRING_DESC_F_NEXT;
+  ind[0].next = 1;
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int k = 1; k <= n; k++){
+    ind[k].addr = (uint64) bs[k-1]->data;
+    ind[k].len = BSIZE;
+    if(write)
+      ind[k].flags = 0; // device reads b->data
+    else
+      ind[k].flags = VRING_DESC_F_WRITE; // device writes b->data
+    ind[k].flags |= VRING_DESC_F_NEXT;
+    ind[k].next = k+1;
+  }
+
+  disk.info[i].status = 0xff; // device writes 0 on success
+  ind[n+1].addr = (uint64) &disk.info[i].status;
+  ind[n+1].len = 1;
+  ind[n+1].flags = VRING_DESC_F_WRITE; // device writes the status
+  ind[n+1].next = 0;
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[i].addr = (uint64) ind;
+  disk.desc[i].len = (n+2) * sizeof(struct virtq_desc);
+  disk.desc[i].flags = VRING_DESC_F_INDIRECT;
+  disk.desc[i].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record struct bufs for virtio_disk_intr().
+  for(int k = 0; k < n; k++){
+    bs[k]->disk = 1;
+    disk.info[i].b[k] = bs[k];
+  }
+  disk.info[i].n = n;
+  disk.info[i].async = async;
 
-  // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  // tell the device the index of our descriptor.
+  disk.avail->ring[disk.avail->idx % NUM] = i;
 
   __sync_synchronize();
 
@@ -277,17 +258,66 @@ virtio_disk_rw(struct buf *b, int write)
   disk.avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+}
 
+static void
+notify(void)
+{
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rwv(&b, 1, write);
+}
+
+// start reading b, for read-ahead, without waiting.
+// the caller holds b's sleeplock and a reference, both of
+// which virtio_disk_intr() gives to bdone() when the read
+// finishes. returns -1 if the disk has no free descriptors.
+int
+virtio_disk_readahead(struct buf *b)
+{
+  int i;
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+  acquire(&disk.vdisk_lock);
+  if((i = alloc_desc()) < 0){
+    release(&disk.vdisk_lock);
+    return -1;
   }
+  submit(&b, 1, 0, i, 1);
+  notify();
+  release(&disk.vdisk_lock);
+  return 0;
+}
+
+// read or write the n bufs in bs, and wait for them.
+// each run of consecutive blocks becomes a single request,
+// and the device is notified once for all of them.
+void
+virtio_disk_rwv(struct buf **bs, int n, int write)
+{
+  int i, start, end;
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  acquire(&disk.vdisk_lock);
+  for(start = 0; start < n; start = end){
+    end = start + 1;
+    while(end < n && end - start < MAXSEG &&
+          bs[end]->blockno == bs[end-1]->blockno + 1)
+      end++;
+    while((i = alloc_desc()) < 0){
+      notify();  // let the device drain what we've queued.
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    submit(bs + start, end - start, write, i, 0);
+  }
+  notify();
 
+  for(i = 0; i < n; i++){
+    while(bs[i]->disk == 1)
+      sleep(bs[i], &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
@@ -316,9 +346,16 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    for(int k = 0; k < disk.info[id].n; k++){
+      struct buf *b = disk.info[id].b[k];
+      b->disk = 0;   // disk is done with buf
+      if(disk.info[id].async)
+        bdone(b);
+      else
+        wakeup(b);
+    }
+    disk.info[id].n = 0;
+    free_desc(id);
 
     disk.used_idx += 1;
   }
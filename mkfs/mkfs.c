@@ -22,7 +22,8 @@
 
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = FSSIZE/32 < LOGSIZE ? LOGSIZE :
+           FSSIZE/32 > MAXLOGSIZE ? MAXLOGSIZE : FSSIZE/32;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +41,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint xmap(struct dinode *din, uint fbn);
 void die(const char *);
 
 // convert to riscv byte order
@@ -76,6 +78,7 @@ main(int argc, char *argv[])
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+  static_assert(sizeof(struct xblock) == BSIZE, "Extent block must fill a block!");
 
   if(argc < 2){
     fprintf(stderr, "Usage: mkfs fs.img files...\n");
@@ -251,6 +254,60 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding file block fbn of din, which
+// must be mapped already or be just past the last block.
+// Appends are allocated in order, so they usually grow
+// the last extent.
+uint
+xmap(struct dinode *din, uint fbn)
+{
+  struct extent *ext;
+  struct xblock xb, nxb;
+  uint i, n, base, blk, next, x, nx;
+
+  ext = din->ext;
+  n = NEXTENT;
+  next = xint(din->xblock);
+  base = 0;
+  blk = 0;
+  for(;;){
+    for(i = 0; i < n && xint(ext[i].len) > 0; i++){
+      if(fbn < base + xint(ext[i].len))
+        return xint(ext[i].start) + fbn - base;
+      base += xint(ext[i].len);
+    }
+    if(i < n || next == 0)
+      break;
+    blk = next;
+    rsect(blk, (char*)&xb);
+    ext = xb.ext;
+    n = XPB;
+    next = xint(xb.next);
+  }
+
+  assert(fbn == base);
+  x = freeblock++;
+  if(i > 0 && xint(ext[i-1].start) + xint(ext[i-1].len) == x){
+    ext[i-1].len = xint(xint(ext[i-1].len) + 1);
+  } else if(i < n){
+    ext[i].start = xint(x);
+    ext[i].len = xint(1);
+  } else {
+    nx = freeblock++;
+    bzero(&nxb, sizeof(nxb));
+    nxb.ext[0].start = xint(x);
+    nxb.ext[0].len = xint(1);
+    wsect(nx, (char*)&nxb);
+    if(blk)
+      xb.next = xint(nx);
+    else
+      din->xblock = xint(nx);
+  }
+  if(blk)
+    wsect(blk, (char*)&xb);
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -258,7 +315,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,22 +323,7 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = xmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
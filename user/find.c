@@ -32,9 +32,12 @@ int find(const char* target, const char* root, const char* prefix)
 		return 0;
 	}
 
-	// dirent stands for dir entry.
-	// A dir is a file containing a number of dirents.
-	struct dirent de;
+	// A dir is a file containing a number of dir entries.
+	// getdents() returns a batch of them at a time,
+	// each with the meta-data of its file.
+	// The batch is kept small since find() recurses.
+	struct dirstat ds[4];
+	int n;
 	// Meta-data of a file.
 	struct stat st;
 
@@ -71,62 +74,51 @@ int find(const char* target, const char* root, const char* prefix)
 		strcpy(buf, prefix);
 		p = buf + strlen(buf);
 
-		// read each dir entry.
-		while(read(rfd, &de, sizeof(de)) == sizeof(de))
+		// read the dir entries, a batch at a time.
+		while((n = getdents(rfd, ds, 4)) > 0)
 		{
-			if (0 == de.inum) // somehow the dir stores inode 0
-				continue; // ignore.
-						 
-			// de.name is not ended by 0 if the len is 14.
-			// Thus, do a memmove, and append 0 at the end.
-			// If the len < 14, then it is ended by 0, and the extra 0
-			// does not matter.
-			memmove(p, de.name, DIRSIZ);
-			*(p + DIRSIZ) = '\0';
-
-			// st is unused now, so just recycle it.
-			// Even if we know the inum, we cannot access it this way,
-			// and still have to fallback to accessing it with the path.
-			if (stat(buf, &st) < 0)
+			for (int i = 0; i < n; i++)
 			{
-				printf("cannot stat %s", buf);
-				continue;
-			}
+				// getdents() skips free entries (inode 0),
+				// and ends each name with 0.
+				strcpy(p, ds[i].name);
 
-			// now st is the this entry in root.
-			switch (st.type)
-			{
-			case T_DEVICE:
-				break;
-			case T_FILE:
-				// print if the names match.
-				if (0 == strcmp(p, target))
+				// ds[i] already has the entry's meta-data,
+				// so there is no need to stat() it by path.
+				switch (ds[i].type)
 				{
-					printf("%s\n", buf);
-				}
-				break;
-			case T_DIR:
-				// Recurse into the entry,
-				// if it's not . or ..
-				
-				if ((0 == strcmp(".", p)) ||
-					(0 == strcmp("..", p))
-				) {
+				case T_DEVICE:
 					break;
-				}
-				else 
-				{
-					// append '/' at then end of prefix.
-					char new_prefix[512];
-					strcpy(new_prefix, buf);
-					int len = strlen(new_prefix);
-					new_prefix[len++] = '/';
-					new_prefix[len++] = '\0';
+				case T_FILE:
+					// print if the names match.
+					if (0 == strcmp(p, target))
+					{
+						printf("%s\n", buf);
+					}
+					break;
+				case T_DIR:
+					// Recurse into the entry,
+					// if it's not . or ..
+				
+					if ((0 == strcmp(".", p)) ||
+						(0 == strcmp("..", p))
+					) {
+						break;
+					}
+					else 
+					{
+						// append '/' at then end of prefix.
+						char new_prefix[512];
+						strcpy(new_prefix, buf);
+						int len = strlen(new_prefix);
+						new_prefix[len++] = '/';
+						new_prefix[len++] = '\0';
 
-					if (find(target, buf, new_prefix) < 0)
-						return -1;
+						if (find(target, buf, new_prefix) < 0)
+							return -1;
+					}
+					break;
 				}
-				break;
 			}
 		}
 		break;
@@ -1,4 +1,5 @@
 struct stat;
+struct dirstat;
 
 // system calls
 int fork(void);
@@ -22,6 +23,9 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int getdents(int, struct dirstat*, int);
+int usleep(int);
+int nice(int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -578,9 +578,11 @@ writetest(char *s)
   }
 }
 
+// a file bigger than the old direct+indirect limit.
 void
 writebig(char *s)
 {
+  enum { N = 600 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -589,7 +591,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < N; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed i=%d\n", s, i);
@@ -609,7 +611,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n != MAXFILE){
+      if(n != N){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -2571,6 +2573,292 @@ sbrk8000(char *s)
 
 
 
+// fork shares pages copy-on-write. do parent and child
+// each see only their own writes, including writes
+// the kernel makes on their behalf?
+void
+cowfork(char *s)
+{
+  enum { N = 16 };
+  char *a;
+  int pid, xstatus, fds[2];
+
+  a = sbrk(N*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++)
+    a[i*PGSIZE] = 'p';
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int i = 0; i < N; i += 2)
+      a[i*PGSIZE] = 'c';
+    // copyout() into a shared page.
+    if(read(fds[0], a + PGSIZE, 1) != 1 || a[PGSIZE] != 'x')
+      exit(1);
+    for(int i = 0; i < N; i++){
+      char want = (i % 2 == 0) ? 'c' : 'p';
+      if(i == 1)
+        want = 'x';
+      if(a[i*PGSIZE] != want)
+        exit(1);
+    }
+    exit(0);
+  }
+  if(write(fds[1], "x", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < N; i++){
+    if(a[i*PGSIZE] != 'p'){
+      printf("%s: child write leaked into parent\n", s);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// two files appended to a block at a time in turn, each
+// closed after every block so that it keeps no blocks
+// reserved: after the first reservation is used up, each
+// file's next block has just been taken by the other, so
+// both get a one-block extent per block, more than the
+// inode and an extent block hold. can both be read back?
+void
+extents(char *s)
+{
+  enum { N = 160 };
+  int fd[2], i, j, k, n;
+  char *names[2] = { "ext0", "ext1" };
+
+  for(j = 0; j < 2; j++){
+    fd[j] = open(names[j], O_CREATE|O_RDWR|O_TRUNC);
+    if(fd[j] < 0){
+      printf("%s: create %s failed\n", s, names[j]);
+      exit(1);
+    }
+    close(fd[j]);
+  }
+  for(i = 0; i < N; i++){
+    for(j = 0; j < 2; j++){
+      fd[j] = open(names[j], O_RDWR);
+      if(fd[j] < 0){
+        printf("%s: open %s failed\n", s, names[j]);
+        exit(1);
+      }
+      // there is no lseek; read up to the end.
+      for(k = 0; k < i; k += n){
+        n = i - k < BUFSZ/BSIZE ? i - k : BUFSZ/BSIZE;
+        if(read(fd[j], buf, n*BSIZE) != n*BSIZE){
+          printf("%s: read %s failed i=%d\n", s, names[j], i);
+          exit(1);
+        }
+      }
+      ((int*)buf)[0] = i;
+      ((int*)buf)[1] = j;
+      if(write(fd[j], buf, BSIZE) != BSIZE){
+        printf("%s: write %s failed i=%d\n", s, names[j], i);
+        exit(1);
+      }
+      close(fd[j]);
+    }
+  }
+  for(j = 0; j < 2; j++){
+    fd[j] = open(names[j], O_RDONLY);
+    if(fd[j] < 0){
+      printf("%s: open %s failed\n", s, names[j]);
+      exit(1);
+    }
+    for(i = 0; i < N; i++){
+      if(read(fd[j], buf, BSIZE) != BSIZE ||
+         ((int*)buf)[0] != i || ((int*)buf)[1] != j){
+        printf("%s: %s block %d is wrong\n", s, names[j], i);
+        exit(1);
+      }
+    }
+    if(read(fd[j], buf, BSIZE) != 0){
+      printf("%s: %s too long\n", s, names[j]);
+      exit(1);
+    }
+    close(fd[j]);
+    if(unlink(names[j]) < 0){
+      printf("%s: unlink %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+}
+
+// getdents() returns each entry once, with its type and size.
+void
+getdentstest(char *s)
+{
+  enum { N = 40 };
+  struct dirstat ds[7];
+  char name[8];  // "gdd/fNN"
+  int fd, i, n, seen[N], dots;
+
+  if(mkdir("gdd") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  strcpy(name, "gdd/f");
+  name[7] = 0;
+  for(i = 0; i < N; i++){
+    name[5] = '0' + i / 10;
+    name[6] = '0' + i % 10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    if(write(fd, buf, i) != i){
+      printf("%s: write %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    seen[i] = 0;
+  }
+  // leave a hole in the directory.
+  if(unlink("gdd/f05") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  seen[5] = 1;
+
+  if((fd = open("gdd", O_RDONLY)) < 0){
+    printf("%s: open gdd failed\n", s);
+    exit(1);
+  }
+  dots = 0;
+  while((n = getdents(fd, ds, 7)) > 0){
+    for(i = 0; i < n; i++){
+      if(strcmp(ds[i].name, ".") == 0 || strcmp(ds[i].name, "..") == 0){
+        if(ds[i].type != T_DIR){
+          printf("%s: %s is not a directory\n", s, ds[i].name);
+          exit(1);
+        }
+        dots++;
+        continue;
+      }
+      int j = atoi(ds[i].name + 1);
+      if(ds[i].name[0] != 'f' || j < 0 || j >= N || seen[j]++){
+        printf("%s: unexpected entry %s\n", s, ds[i].name);
+        exit(1);
+      }
+      if(ds[i].type != T_FILE || ds[i].size != j || ds[i].nlink != 1){
+        printf("%s: %s has wrong type or size\n", s, ds[i].name);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(n < 0 || dots != 2){
+    printf("%s: getdents failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    if(!seen[i]){
+      printf("%s: entry f%d missing\n", s, i);
+      exit(1);
+    }
+  }
+
+  if((fd = open("gdd/f00", O_RDONLY)) < 0 || getdents(fd, ds, 7) != -1){
+    printf("%s: getdents of a file succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    if(i == 5)
+      continue;
+    name[5] = '0' + i / 10;
+    name[6] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("gdd") < 0){
+    printf("%s: unlink gdd failed\n", s);
+    exit(1);
+  }
+}
+
+// many processes in usleep() each wake at about their deadline.
+void
+usleeptest(char *s)
+{
+  int i, pid, t0, xstatus;
+
+  t0 = uptime();
+  for(i = 0; i < 8; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0)
+      exit(usleep(50000 * (i % 4 + 1)) < 0);
+  }
+  for(i = 0; i < 8; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: usleep failed\n", s);
+      exit(1);
+    }
+  }
+  if(usleep(1) < 0 || usleep(0) < 0){
+    printf("%s: short usleep failed\n", s);
+    exit(1);
+  }
+  // the longest sleep is 2 ticks; allow for a busy machine.
+  if(uptime() - t0 > 20){
+    printf("%s: sleepers woke late\n", s);
+    exit(1);
+  }
+}
+
+// nice() adjusts and clamps the priority, and fork() inherits it.
+void
+nicetest(char *s)
+{
+  int pid, xstatus;
+
+  if(nice(0) != 0 || nice(5) != 5 || nice(100) != 19 || nice(-100) != -20){
+    printf("%s: nice returned wrong value\n", s);
+    exit(1);
+  }
+  nice(30);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(nice(0) != 10);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child did not inherit nice\n", s);
+    exit(1);
+  }
+}
+
 // regression test. test whether exec() leaks memory if one of the
 // arguments is invalid. the test passes if the kernel doesn't panic.
 void
@@ -2650,6 +2938,11 @@ struct test {
   {sbrklast, "sbrklast"},
   {sbrk8000, "sbrk8000"},
   {badarg, "badarg" },
+  {cowfork, "cowfork" },
+  {extents, "extents" },
+  {getdentstest, "getdents" },
+  {usleeptest, "usleep" },
+  {nicetest, "nice" },
 
   { 0, 0},
 };